@@ -1,14 +1,50 @@
 // STEFAN MIRUNA ANDREEA 314CA
+#define _GNU_SOURCE
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
 
 #define ALPHABET_SIZE 26
 #define MAX_WORD_LENGTH 50
 #define MAX_COMMAND 30
 #define MAX_FILENAME 30
 
+// limits used by the server mode
+#define SERVE_IN_BUF 4096
+#define SERVE_OUT_HIGH (1 << 20)
+#define SERVE_MAX_PIPELINE 64
+#define SERVE_MAX_EVENTS 64
+
+/* a checkpoint is written after this many journal records, or after this
+many seconds if there is at least one record */
+#define JOURNAL_CHECKPOINT_RECORDS 100000
+#define JOURNAL_CHECKPOINT_INTERVAL 60
+
+// settings of the word filter
+#define FILTER_BLOOM_HASHES 4
+#define FILTER_MIN_BLOOM_BITS 512
+#define FILTER_MIN_SET_CAP 1024
+#define FILTER_MIN_ARENA 4096
+#define FILTER_MIN_REBUILD 1024
+
+// the answers of a filter lookup
+#define FILTER_ABSENT 0
+#define FILTER_PRESENT 1
+#define FILTER_UNKNOWN 2
+
 /* useful macro for handling error codes */
 #define DIE(assertion, call_description)                                       \
 	do {                                                                       \
@@ -36,12 +72,30 @@ struct trie_node_t {
 	int n_children;
 };
 
+typedef struct journal_t journal_t;
+typedef struct filter_t filter_t;
+
 typedef struct trie_t trie_t;
 struct trie_t {
 	// pointer to the root node of the trie
 	trie_node_t *root;
+
+	/* lock taken in read mode by the queries and in write mode by the
+	updates, whenever other threads (server workers, the checkpoint thread)
+	may use the trie at the same time */
+	pthread_rwlock_t lock;
+
+	/* the journal that records the updates, or NULL if the updates are not
+	saved on disk */
+	journal_t *journal;
+
+	/* the filter that answers some lookups without the trie, or NULL if it
+	is not used */
+	filter_t *filter;
 };
 
+void journal_append(journal_t *journal, char op, char word[MAX_WORD_LENGTH]);
+
 // function that creates a new node and returns pointer to it
 trie_node_t *create_node(char letter)
 {
@@ -75,12 +129,463 @@ trie_t *create_trie(void)
 	DIE(!trie, "malloc failed\n");
 
 	trie->root = create_node('\0');
+	trie->journal = NULL;
+	trie->filter = NULL;
+
+	/* let the updates go before new readers, so that a stream of queries
+	does not delay an INSERT indefinitely */
+	pthread_rwlockattr_t attr;
+	pthread_rwlockattr_init(&attr);
+	pthread_rwlockattr_setkind_np(&attr,
+		PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+	pthread_rwlock_init(&trie->lock, &attr);
+	pthread_rwlockattr_destroy(&attr);
 
 	return trie;
 }
 
-// insert a new word in the trie
-void insert_word(trie_t *trie, char word[MAX_WORD_LENGTH])
+/* the filter answers some questions about whole words without walking the
+trie. A Bloom filter tells that a word is surely absent, and an exact hash set
+of the words tells if a word is present or not. REMOVE of a missing word and
+AUTOCORRECT with k = 0 use it to skip the trie.
+
+Both structures share a memory budget: the Bloom filter gets an eighth of it
+and the hash set the rest. The words of the hash set are kept in a single
+buffer (the arena), so the budget covers the table and the arena exactly,
+without the overhead of a separate allocation for every word. If the words
+do not fit in the hash set anymore,
+the set is dropped and only the Bloom filter stays in use. A Bloom filter
+cannot forget a word, so after many removals it is rebuilt from the trie */
+typedef struct filter_stats_t filter_stats_t;
+struct filter_stats_t {
+	/* the number of lookups, of the ones answered by the Bloom filter (the
+	word is absent) and of the ones answered by the hash set */
+	unsigned long lookups;
+	unsigned long bloom_hits;
+	unsigned long set_hits;
+};
+
+typedef struct filter_entry_t filter_entry_t;
+struct filter_entry_t {
+	uint64_t hash;
+
+	/* the position of the word in the arena and its length; a length of 0
+	marks an empty slot */
+	uint32_t offset;
+	uint32_t len;
+};
+
+struct filter_t {
+	size_t budget;
+
+	// the bits of the Bloom filter; their number is a power of 2
+	unsigned char *bloom;
+	uint64_t bloom_bits;
+
+	// the number of words removed since the Bloom filter was built
+	long bloom_removed;
+
+	/* the hash set, with open addressing and linear probing; entries is
+	NULL once the set has been dropped for exceeding the budget */
+	filter_entry_t *entries;
+	size_t cap;
+
+	/* the words of the hash set, one after the other; garbage counts the
+	bytes of the removed words, which are reclaimed when the arena fills */
+	char *arena;
+	size_t arena_len;
+	size_t arena_cap;
+	size_t arena_garbage;
+
+	// the memory used by the table and the arena, and its limit
+	size_t set_bytes;
+	size_t set_budget;
+
+	// the number of distinct words in the trie
+	long n_words;
+
+	// the statistics of the REMOVE and AUTOCORRECT k = 0 lookups
+	filter_stats_t remove_stats;
+	filter_stats_t correct_stats;
+	unsigned long false_positives;
+};
+
+// FNV-1a hash of a word
+uint64_t hash_word(char *word)
+{
+	uint64_t hash = 14695981039346656037ULL;
+
+	for (int i = 0; word[i] != '\0'; i++) {
+		hash ^= (unsigned char)word[i];
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+/* the bits of a word in the Bloom filter are formed from the two halves of
+its hash */
+void bloom_add(filter_t *filter, uint64_t hash)
+{
+	uint32_t h1 = hash, h2 = (hash >> 32) | 1;
+
+	for (uint32_t i = 0; i < FILTER_BLOOM_HASHES; i++) {
+		uint64_t bit = (h1 + i * h2) & (filter->bloom_bits - 1);
+
+		filter->bloom[bit / 8] |= 1 << (bit % 8);
+	}
+}
+
+// returns 0 if the word is surely absent, 1 if it may be present
+int bloom_may_contain(filter_t *filter, uint64_t hash)
+{
+	uint32_t h1 = hash, h2 = (hash >> 32) | 1;
+
+	for (uint32_t i = 0; i < FILTER_BLOOM_HASHES; i++) {
+		uint64_t bit = (h1 + i * h2) & (filter->bloom_bits - 1);
+
+		if (!(filter->bloom[bit / 8] & (1 << (bit % 8))))
+			return 0;
+	}
+
+	return 1;
+}
+
+/* find the slot of a word in the hash set, or the empty slot where it would
+be placed */
+size_t set_find(filter_t *filter, char *word, uint64_t hash)
+{
+	size_t idx = hash & (filter->cap - 1);
+	size_t len = strlen(word);
+
+	while (filter->entries[idx].len) {
+		if (filter->entries[idx].hash == hash &&
+			filter->entries[idx].len == len &&
+			memcmp(filter->arena + filter->entries[idx].offset, word,
+				   len) == 0)
+			break;
+		idx = (idx + 1) & (filter->cap - 1);
+	}
+
+	return idx;
+}
+
+// drop the hash set, after which only the Bloom filter is used
+void set_drop(filter_t *filter)
+{
+	free(filter->entries);
+	free(filter->arena);
+	filter->entries = NULL;
+	filter->arena = NULL;
+	filter->cap = 0;
+	filter->arena_len = 0;
+	filter->arena_cap = 0;
+	filter->arena_garbage = 0;
+	filter->set_bytes = 0;
+}
+
+/* move the words of the hash set to a new arena of new_cap bytes, leaving
+out the removed ones; returns 0 if it would not fit in the budget */
+int arena_rebuild(filter_t *filter, size_t new_cap)
+{
+	size_t new_bytes = filter->cap * sizeof(filter_entry_t) + new_cap;
+
+	if (new_bytes > filter->set_budget)
+		return 0;
+
+	char *arena = malloc(new_cap);
+	DIE(!arena, "malloc failed\n");
+
+	size_t len = 0;
+	for (size_t i = 0; i < filter->cap; i++) {
+		filter_entry_t *entry = &filter->entries[i];
+
+		if (!entry->len)
+			continue;
+
+		memcpy(arena + len, filter->arena + entry->offset, entry->len);
+		entry->offset = len;
+		len += entry->len;
+	}
+
+	free(filter->arena);
+	filter->arena = arena;
+	filter->arena_len = len;
+	filter->arena_cap = new_cap;
+	filter->arena_garbage = 0;
+	filter->set_bytes = new_bytes;
+
+	return 1;
+}
+
+/* double the capacity of the hash set; returns 0 if the set would not fit
+in its budget anymore */
+int set_grow(filter_t *filter)
+{
+	size_t new_cap = filter->cap * 2;
+	size_t new_bytes = filter->set_bytes +
+					   filter->cap * sizeof(filter_entry_t);
+
+	if (new_bytes > filter->set_budget)
+		return 0;
+
+	filter_entry_t *old = filter->entries;
+	size_t old_cap = filter->cap;
+
+	filter->entries = calloc(new_cap, sizeof(filter_entry_t));
+	DIE(!filter->entries, "calloc failed\n");
+	filter->cap = new_cap;
+	filter->set_bytes = new_bytes;
+
+	for (size_t i = 0; i < old_cap; i++) {
+		if (!old[i].len)
+			continue;
+
+		size_t idx = old[i].hash & (new_cap - 1);
+		while (filter->entries[idx].len)
+			idx = (idx + 1) & (new_cap - 1);
+		filter->entries[idx] = old[i];
+	}
+
+	free(old);
+	return 1;
+}
+
+// create a filter that uses at most (about) budget bytes
+filter_t *filter_create(size_t budget)
+{
+	filter_t *filter = calloc(1, sizeof(filter_t));
+	DIE(!filter, "calloc failed\n");
+
+	filter->budget = budget;
+
+	// the largest power of 2 number of bits that fits in an eighth of it
+	filter->bloom_bits = FILTER_MIN_BLOOM_BITS;
+	while (filter->bloom_bits * 2 <= budget)
+		filter->bloom_bits *= 2;
+
+	filter->bloom = calloc(filter->bloom_bits / 8, 1);
+	DIE(!filter->bloom, "calloc failed\n");
+
+	size_t bloom_bytes = filter->bloom_bits / 8;
+	filter->set_budget = budget > bloom_bytes ? budget - bloom_bytes : 0;
+
+	filter->cap = FILTER_MIN_SET_CAP;
+	filter->arena_cap = FILTER_MIN_ARENA;
+	filter->set_bytes = filter->cap * sizeof(filter_entry_t) +
+						filter->arena_cap;
+	if (filter->set_bytes <= filter->set_budget) {
+		filter->entries = calloc(filter->cap, sizeof(filter_entry_t));
+		DIE(!filter->entries, "calloc failed\n");
+		filter->arena = malloc(filter->arena_cap);
+		DIE(!filter->arena, "malloc failed\n");
+	} else {
+		filter->cap = 0;
+		filter->arena_cap = 0;
+		filter->set_bytes = 0;
+	}
+
+	return filter;
+}
+
+void filter_free(filter_t *filter)
+{
+	if (filter->entries)
+		set_drop(filter);
+
+	free(filter->bloom);
+	free(filter);
+}
+
+// note that a word which was not in the trie has been inserted
+void filter_add(filter_t *filter, char word[MAX_WORD_LENGTH])
+{
+	uint64_t hash = hash_word(word);
+
+	bloom_add(filter, hash);
+	filter->n_words++;
+
+	if (!filter->entries)
+		return;
+
+	// keep the load factor of the hash set under 1/2
+	if (2 * filter->n_words > (long)filter->cap && !set_grow(filter)) {
+		set_drop(filter);
+		return;
+	}
+
+	/* make room in the arena: reclaim the removed words if they are many,
+	otherwise double the arena */
+	size_t len = strlen(word);
+	if (filter->arena_len + len > filter->arena_cap) {
+		size_t live = filter->arena_len - filter->arena_garbage;
+		size_t new_cap = filter->arena_cap;
+
+		if (2 * filter->arena_garbage < filter->arena_cap ||
+			live + len > new_cap)
+			new_cap *= 2;
+		while (live + len > new_cap)
+			new_cap *= 2;
+
+		if (!arena_rebuild(filter, new_cap)) {
+			set_drop(filter);
+			return;
+		}
+	}
+
+	size_t idx = set_find(filter, word, hash);
+	filter->entries[idx].hash = hash;
+	filter->entries[idx].offset = filter->arena_len;
+	filter->entries[idx].len = len;
+	memcpy(filter->arena + filter->arena_len, word, len);
+	filter->arena_len += len;
+}
+
+// recursive function that adds all the words of a subtrie to the Bloom filter
+void bloom_add_subtrie(filter_t *filter, trie_node_t *node,
+					   char word[MAX_WORD_LENGTH], int length)
+{
+	if (node->end_of_word > 0) {
+		word[length] = '\0';
+		bloom_add(filter, hash_word(word));
+	}
+
+	for (int i = 0; i < ALPHABET_SIZE; i++) {
+		if (!node->children[i])
+			continue;
+
+		word[length] = node->children[i]->letter;
+		bloom_add_subtrie(filter, node->children[i], word, length + 1);
+	}
+}
+
+// note that a word has been removed from the trie
+void filter_remove(filter_t *filter, trie_t *trie, char word[MAX_WORD_LENGTH])
+{
+	filter->n_words--;
+	filter->bloom_removed++;
+
+	if (filter->entries) {
+		uint64_t hash = hash_word(word);
+		size_t idx = set_find(filter, word, hash);
+		size_t mask = filter->cap - 1;
+
+		if (filter->entries[idx].len) {
+			filter->arena_garbage += filter->entries[idx].len;
+			filter->entries[idx].len = 0;
+
+			/* move back the words after the freed slot that would not be
+			found anymore, because their probing passed through it */
+			for (size_t j = (idx + 1) & mask; filter->entries[j].len;
+				 j = (j + 1) & mask) {
+				size_t home = filter->entries[j].hash & mask;
+
+				if (((j - home) & mask) < ((j - idx) & mask))
+					continue;
+
+				filter->entries[idx] = filter->entries[j];
+				filter->entries[j].len = 0;
+				idx = j;
+			}
+		}
+	}
+
+	/* the bits of the removed words make the Bloom filter answer "maybe"
+	more and more often, so rebuild it when they are many */
+	if (filter->bloom_removed >= FILTER_MIN_REBUILD &&
+		2 * filter->bloom_removed > filter->n_words) {
+		char new_word[MAX_WORD_LENGTH];
+
+		memset(filter->bloom, 0, filter->bloom_bits / 8);
+		bloom_add_subtrie(filter, trie->root, new_word, 0);
+		filter->bloom_removed = 0;
+	}
+}
+
+/* check a word against the filter. A lookup counts as answered by the hash
+set only if the caller can skip the trie with that answer: always for
+AUTOCORRECT with k = 0, but only for absent words for REMOVE, so the caller
+tells if FILTER_PRESENT answers its question (present_answers). The
+statistics are updated atomically, because the server workers look words up
+at the same time */
+int filter_lookup(filter_t *filter, char word[MAX_WORD_LENGTH],
+				  filter_stats_t *stats, int present_answers)
+{
+	uint64_t hash = hash_word(word);
+
+	__atomic_fetch_add(&stats->lookups, 1, __ATOMIC_RELAXED);
+
+	if (!bloom_may_contain(filter, hash)) {
+		__atomic_fetch_add(&stats->bloom_hits, 1, __ATOMIC_RELAXED);
+		return FILTER_ABSENT;
+	}
+
+	if (!filter->entries)
+		return FILTER_UNKNOWN;
+
+	if (filter->entries[set_find(filter, word, hash)].len) {
+		if (present_answers)
+			__atomic_fetch_add(&stats->set_hits, 1, __ATOMIC_RELAXED);
+		return FILTER_PRESENT;
+	}
+
+	__atomic_fetch_add(&stats->set_hits, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&filter->false_positives, 1, __ATOMIC_RELAXED);
+	return FILTER_ABSENT;
+}
+
+// forget the statistics gathered so far
+void filter_reset_stats(filter_t *filter)
+{
+	memset(&filter->remove_stats, 0, sizeof(filter_stats_t));
+	memset(&filter->correct_stats, 0, sizeof(filter_stats_t));
+	filter->false_positives = 0;
+}
+
+// print the statistics of one kind of lookups
+void print_filter_stats(char *name, filter_stats_t *stats, FILE *out)
+{
+	unsigned long lookups = __atomic_load_n(&stats->lookups,
+											 __ATOMIC_RELAXED);
+	unsigned long bloom_hits = __atomic_load_n(&stats->bloom_hits,
+												__ATOMIC_RELAXED);
+	unsigned long set_hits = __atomic_load_n(&stats->set_hits,
+											  __ATOMIC_RELAXED);
+	double pct = lookups ? 100.0 * (bloom_hits + set_hits) / lookups : 0;
+
+	fprintf(out, "%s: %lu lookups, %lu answered by the Bloom filter, %lu by "
+			"the hash set (%.1f%% without the trie)\n", name, lookups,
+			bloom_hits, set_hits, pct);
+}
+
+// print the state of the filter and how often it was useful
+void print_stats(trie_t *trie, FILE *out)
+{
+	filter_t *filter = trie->filter;
+
+	if (!filter) {
+		fprintf(out, "Filter disabled\n");
+		return;
+	}
+
+	print_filter_stats("REMOVE", &filter->remove_stats, out);
+	print_filter_stats("AUTOCORRECT k=0", &filter->correct_stats, out);
+
+	fprintf(out, "Bloom filter: %lu bits, %lu false positives\n",
+			(unsigned long)filter->bloom_bits,
+			__atomic_load_n(&filter->false_positives, __ATOMIC_RELAXED));
+
+	if (filter->entries)
+		fprintf(out, "Hash set: %ld words, %zu of %zu bytes\n",
+				filter->n_words, filter->set_bytes, filter->set_budget);
+	else
+		fprintf(out, "Hash set: dropped, the words exceed %zu bytes\n",
+				filter->set_budget);
+}
+
+/* find the node containing the last letter of a word, adding the missing
+nodes on the way */
+trie_node_t *find_or_create_path(trie_t *trie, char word[MAX_WORD_LENGTH])
 {
 	trie_node_t *curr = trie->root;
 
@@ -104,10 +609,24 @@ void insert_word(trie_t *trie, char word[MAX_WORD_LENGTH])
 		curr = curr->children[idx];
 	}
 
+	return curr;
+}
+
+// insert a new word in the trie
+void insert_word(trie_t *trie, char word[MAX_WORD_LENGTH])
+{
+	trie_node_t *curr = find_or_create_path(trie, word);
+
 	/* if we have reached the last letter of the word, mark it by increasing
 	the counter end_of_word, which will contain the number of words ending in
 	that letter */
 	curr->end_of_word++;
+
+	if (trie->filter && curr->end_of_word == 1)
+		filter_add(trie->filter, word);
+
+	if (trie->journal)
+		journal_append(trie->journal, 'I', word);
 }
 
 // recursive function that removes a whole subtrie
@@ -141,6 +660,13 @@ void recursive_subtrie_deletion(trie_node_t *node, trie_t *trie)
 // function that removes a node form the trie
 void remove_word(trie_t *trie, char word[MAX_WORD_LENGTH])
 {
+	/* a word that the filter knows to be missing is not looked for in the
+	trie at all */
+	if (trie->filter && filter_lookup(trie->filter, word,
+									  &trie->filter->remove_stats, 0) ==
+						FILTER_ABSENT)
+		return;
+
 	// start from the root
 	trie_node_t *curr = trie->root;
 
@@ -176,11 +702,23 @@ void remove_word(trie_t *trie, char word[MAX_WORD_LENGTH])
 		curr = curr->children[idx];
 	}
 
+	/* the word exists only if its last letter is marked as a word end;
+	otherwise the removal changes nothing and is not recorded */
+	int existed = curr->end_of_word > 0;
+
+	if (existed && trie->journal)
+		journal_append(trie->journal, 'R', word);
+
 	/* after finishing the previous loop, we will have a pointer to the node
 	that contains the last letter of the word, so we need to change the
 	indicator that lets us know if that node is a word end*/
 	curr->end_of_word = 0;
 
+	/* the filter may rebuild its Bloom filter from the trie, which must not
+	contain the word anymore */
+	if (existed && trie->filter)
+		filter_remove(trie->filter, trie, word);
+
 	/* if the current node has other children, we cannot free it, as there
 	still are other nodes depending on it */
 	if (curr->n_children > 0)
@@ -200,7 +738,7 @@ void remove_word(trie_t *trie, char word[MAX_WORD_LENGTH])
 // recursive function that performs autocorrect
 void autocorrect(trie_t *trie, int diff, int letter_idx, trie_node_t *node,
 				 char new_word[MAX_WORD_LENGTH], int *printed, int k,
-				 char word[MAX_WORD_LENGTH])
+				 char word[MAX_WORD_LENGTH], FILE *out)
 {
 	//check if the node is different from the trie root
 	if (node != trie->root) {
@@ -227,9 +765,9 @@ void autocorrect(trie_t *trie, int diff, int letter_idx, trie_node_t *node,
 
 			// print the new word
 			for (int i = 0 ; i < strlen(word); i++)
-				printf("%c", new_word[i]);
+				fprintf(out, "%c", new_word[i]);
 
-			printf("\n");
+			fprintf(out, "\n");
 
 			return;
 		}
@@ -246,16 +784,17 @@ void autocorrect(trie_t *trie, int diff, int letter_idx, trie_node_t *node,
 		number of differences */
 		if (node->children[i]->letter != word[letter_idx])
 			autocorrect(trie, diff + 1, letter_idx + 1, node->children[i],
-						new_word, printed, k, word);
+						new_word, printed, k, word, out);
 		else
 			autocorrect(trie, diff, letter_idx + 1, node->children[i],
-						new_word, printed, k, word);
+						new_word, printed, k, word, out);
 	}
 }
 
 /* function that prepares autocorrect by initializing some variables that will
 be useful when performing autocorrect */
-void prepare_autocorrect(trie_t *trie, int k, char word[MAX_WORD_LENGTH])
+void prepare_autocorrect(trie_t *trie, int k, char word[MAX_WORD_LENGTH],
+						 FILE *out)
 {
 	/* counter that stores the number of letters in the new word that differ
 	from the original word */
@@ -272,15 +811,32 @@ void prepare_autocorrect(trie_t *trie, int k, char word[MAX_WORD_LENGTH])
 	// initialize the new word with '\0'
 	char new_word[MAX_WORD_LENGTH] = {0};
 
+	/* with k = 0 the only possible answer is the word itself, so the filter
+	can tell the answer if it knows whether the word is in the trie */
+	if (k == 0 && trie->filter) {
+		int found = filter_lookup(trie->filter, word,
+								  &trie->filter->correct_stats, 1);
+
+		if (found == FILTER_PRESENT) {
+			fprintf(out, "%s\n", word);
+			return;
+		}
+
+		if (found == FILTER_ABSENT) {
+			fprintf(out, "No words found\n");
+			return;
+		}
+	}
+
 	// call the recursive autocorrect function
 	autocorrect(trie, diff, letter_idx, trie->root, new_word, &printed,
-				k, word);
+				k, word, out);
 
 	/* if we haven't printed anything in the autocorrect function, it means
 	that we haven't found any suitable word, so we must print a suggestive
 	message */
 	if (printed == 0)
-		printf("No words found\n");
+		fprintf(out, "No words found\n");
 }
 
 /* recursive function that forms the first word (in lexicographical order)
@@ -288,7 +844,7 @@ starting with the given prefix */
 void autocomplete_first_lexico(trie_node_t *node, trie_t *trie,
 							   char first_lexico_word[MAX_WORD_LENGTH],
 							   int prefix_length, int *printed,
-							   trie_node_t *subtrie_root)
+							   trie_node_t *subtrie_root, FILE *out)
 {
 	/* check if the current node is the root of the subtrie, namely the
 	node containing the last letter of the prefix */
@@ -309,9 +865,9 @@ void autocomplete_first_lexico(trie_node_t *node, trie_t *trie,
 
 			// print the word that we have formed
 			for (int i = 0 ; i < prefix_length + 1; i++)
-				printf("%c", first_lexico_word[i]);
+				fprintf(out, "%c", first_lexico_word[i]);
 
-			printf("\n");
+			fprintf(out, "\n");
 			return;
 		}
 	}
@@ -322,7 +878,7 @@ void autocomplete_first_lexico(trie_node_t *node, trie_t *trie,
 		if (node->children[i])
 			autocomplete_first_lexico(node->children[i], trie,
 									  first_lexico_word, prefix_length + 1,
-									  printed, subtrie_root);
+									  printed, subtrie_root, out);
 	}
 }
 
@@ -452,14 +1008,14 @@ void autocomplete_most_frequent(trie_node_t *subtrie_root, trie_node_t *node,
 /* function that initializes the variables that will be particularly used in
 the first type of autocomplete and calls the recursive function */
 void prepare_autocomplete_1(char prefix[MAX_WORD_LENGTH], trie_t *trie,
-							trie_node_t *curr)
+							trie_node_t *curr, FILE *out)
 {
 	/* check if the subtrie root (the node that contains the last letter
 	of the word) is in itself an end of word. In this case, it is also the
 	first word in a lexicographical order starting with this prefix, so we
 	should print it and get out of this function */
 	if (curr->end_of_word > 0) {
-		printf("%s\n", prefix);
+		fprintf(out, "%s\n", prefix);
 		return;
 	}
 
@@ -480,24 +1036,24 @@ void prepare_autocomplete_1(char prefix[MAX_WORD_LENGTH], trie_t *trie,
 	/* call the recursive function that will form the word
 	that we are looking for */
 	autocomplete_first_lexico(curr, trie, first_lexico_word, prefix_length - 1,
-							  &printed, curr);
+							  &printed, curr, out);
 
 	/* if we haven't printed anything, it means that we haven't
 	found any word starting with that prefix */
 	if (printed == 0)
-		printf("No words found\n");
+		fprintf(out, "No words found\n");
 }
 
 /* function that initializes the variables that will be particularly used in
 the second type of autocomplete function and calls the recursive function */
 void prepare_autocomplete_2(char prefix[MAX_WORD_LENGTH], trie_t *trie,
-							trie_node_t *curr)
+							trie_node_t *curr, FILE *out)
 {
 	/* check if the subtrie root (the node that contains the last letter of the
 	word) is in itself an end of word. In this case, it is also the shortest
 	that we could find, so we should print it and get out of the function */
 	if (curr->end_of_word > 0) {
-		printf("%s\n", prefix);
+		fprintf(out, "%s\n", prefix);
 		return;
 	}
 
@@ -522,15 +1078,15 @@ void prepare_autocomplete_2(char prefix[MAX_WORD_LENGTH], trie_t *trie,
 	/* if the minimum length has not been modified, it means that we have not
 	found any word starting with that prefix */
 	if (min_length == -1)
-		printf("No words found\n");
+		fprintf(out, "No words found\n");
 	else
-		printf("%s\n", min_word);
+		fprintf(out, "%s\n", min_word);
 }
 
 /* function that initializes the variables that will be particularly used in
 the third type of autocomplete function and calls the recursive function */
 void prepare_autocomplete_3(char prefix[MAX_WORD_LENGTH], trie_t *trie,
-							trie_node_t *curr)
+							trie_node_t *curr, FILE *out)
 {
 	/* declare and initialize an indicator that tells us if we have
 	printed any word */
@@ -557,16 +1113,16 @@ void prepare_autocomplete_3(char prefix[MAX_WORD_LENGTH], trie_t *trie,
 	/* if the maximum frequency hasn't been modified, it means that we haven't
 	found any word starting with the given prefix */
 	if (max_freq == -1)
-		printf("No words found\n");
+		fprintf(out, "No words found\n");
 	else
-		printf("%s\n", most_freq_word);
+		fprintf(out, "%s\n", most_freq_word);
 }
 
 /* function that is called whenever the user introduces the autocomplete
 command. This function is also responsible for the redirection to a most
 spcific function, according to the autocomplete parameter */
 void prepare_autocomplete(char prefix[MAX_WORD_LENGTH], int crit_number,
-						  trie_t *trie)
+						  trie_t *trie, FILE *out)
 {
 	trie_node_t *curr = trie->root;
 
@@ -592,7 +1148,7 @@ void prepare_autocomplete(char prefix[MAX_WORD_LENGTH], int crit_number,
 	/* if we haven't found the prefix in the trie, print a suggestive
 	message and get out of the function */
 	if (prefix_not_found == 1) {
-		printf("No words found\n");
+		fprintf(out, "No words found\n");
 		return;
 	}
 
@@ -600,36 +1156,36 @@ void prepare_autocomplete(char prefix[MAX_WORD_LENGTH], int crit_number,
 	according function */
 
 	if (crit_number == 1) {
-		prepare_autocomplete_1(prefix, trie, curr);
+		prepare_autocomplete_1(prefix, trie, curr, out);
 		return;
 	}
 
 	if (crit_number == 2) {
-		prepare_autocomplete_2(prefix, trie, curr);
+		prepare_autocomplete_2(prefix, trie, curr, out);
 		return;
 	}
 
 	if (crit_number == 3) {
-		prepare_autocomplete_3(prefix, trie, curr);
+		prepare_autocomplete_3(prefix, trie, curr, out);
 		return;
 	}
 
 	/* if we are here, it means that the crit_number == 0,
 	so we should call all the 3 functions */
 	if (prefix_not_found == 1)
-		printf("No words found\n");
+		fprintf(out, "No words found\n");
 	else
-		prepare_autocomplete_1(prefix, trie, curr);
+		prepare_autocomplete_1(prefix, trie, curr, out);
 
 	if (prefix_not_found == 1)
-		printf("No words found\n");
+		fprintf(out, "No words found\n");
 	else
-		prepare_autocomplete_2(prefix, trie, curr);
+		prepare_autocomplete_2(prefix, trie, curr, out);
 
 	if (prefix_not_found == 1)
-		printf("No words found\n");
+		fprintf(out, "No words found\n");
 	else
-		prepare_autocomplete_3(prefix, trie, curr);
+		prepare_autocomplete_3(prefix, trie, curr, out);
 }
 
 /* recursive function used to free all the nodes of a subtrie,
@@ -646,6 +1202,19 @@ void recursive_free_nodes(trie_node_t *node, trie_t *trie)
 	free(node);
 }
 
+// check if a word only contains lowercase letters of the English alphabet
+int valid_word(char *word)
+{
+	if (word[0] == '\0')
+		return 0;
+
+	for (int i = 0; word[i] != '\0'; i++)
+		if (word[i] < 'a' || word[i] > 'z')
+			return 0;
+
+	return 1;
+}
+
 /* function that parses a file and inserts all the words
 from the file into the trie */
 void load_file(trie_t *trie, char filename[MAX_FILENAME])
@@ -660,54 +1229,1491 @@ void load_file(trie_t *trie, char filename[MAX_FILENAME])
 
 	char word[MAX_WORD_LENGTH];
 
-	// read and insert into the trie all the words until the end of file
-	while (!feof(f)) {
-		fscanf(f, "%s", word);
-		insert_word(trie, word);
+	/* read and insert into the trie all the words until the end of file. The
+	file may come from any client of the server, so the words that are too
+	long or contain other characters than lowercase letters are skipped */
+	while (fscanf(f, "%49s", word) == 1) {
+		int next = fgetc(f);
+
+		if (strlen(word) == MAX_WORD_LENGTH - 1 && next != EOF &&
+			next != ' ' && next != '\t' && next != '\n' && next != '\r') {
+			// skip the rest of the word that did not fit in the buffer
+			fscanf(f, "%*s");
+			continue;
+		}
+
+		if (valid_word(word))
+			insert_word(trie, word);
 	}
 
 	fclose(f);
 }
 
-int main(void)
+/* the journal keeps the updates of the trie across restarts. INSERT and
+REMOVE append a record ("I word" or "R word") to a buffer in memory, and a
+flusher thread writes and fsyncs the buffer; all the records that arrive while
+an fsync is running share the next one (group commit). A checkpoint thread
+regularly saves the whole trie to <path>.checkpoint and starts a new log, so
+that a restart only replays the records written after the last checkpoint.
+
+The log that follows checkpoint number gen is <path>.<gen>. The checkpoint
+file starts with its number, so a crash in the middle of a checkpoint leaves
+either the old checkpoint with both logs or the new one with the new log */
+struct journal_t {
+	trie_t *trie;
+	char *path;
+
+	// the log we are appending to and the number of its checkpoint
+	int fd;
+	unsigned long gen;
+
+	// the number of the last checkpoint that was written successfully
+	unsigned long checkpoint_gen;
+
+	pthread_mutex_t lock;
+
+	/* wakes up the flusher, the threads waiting for their records to reach
+	the disk and the checkpoint thread */
+	pthread_cond_t flush_cond;
+	pthread_cond_t durable_cond;
+	pthread_cond_t checkpoint_cond;
+
+	// the records that have not been written to the log yet
+	char *buf;
+	size_t len;
+	size_t cap;
+
+	/* the number of records appended so far and how many of them are
+	surely on disk; a record is identified by its position in this count */
+	uint64_t appended;
+	uint64_t durable;
+
+	// the number of records written after the last checkpoint
+	long since_checkpoint;
+
+	/* held while writing to the log, so that the checkpoint thread does not
+	switch to a new log in the middle of a write */
+	pthread_mutex_t io_lock;
+
+	int stop;
+	pthread_t flusher;
+	pthread_t checkpointer;
+};
+
+// write the whole buffer to a file descriptor
+void write_all(int fd, char *buf, size_t len)
 {
-	char command[MAX_COMMAND];
-	char word[MAX_WORD_LENGTH];
-	char prefix[MAX_WORD_LENGTH];
-	char filename[MAX_FILENAME];
-	int crit_number;
+	while (len > 0) {
+		ssize_t n = write(fd, buf, len);
 
-	// read the first command introduced by the user
-	scanf("%s", command);
+		if (n < 0 && errno == EINTR)
+			continue;
+		DIE(n < 0, "write failed\n");
 
-	// create the trie that we are going to use
-	trie_t *trie = create_trie();
-	int k;
+		buf += n;
+		len -= n;
+	}
+}
+
+/* fsync the directory containing a file, so that the creation or renaming
+of the file is on disk as well */
+void fsync_dir(char *path)
+{
+	char dir[PATH_MAX];
+	char *slash = strrchr(path, '/');
+
+	if (!slash) {
+		strcpy(dir, ".");
+	} else if (slash == path) {
+		strcpy(dir, "/");
+	} else {
+		snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path), path);
+	}
+
+	int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	DIE(fd < 0, "open failed\n");
+	DIE(fsync(fd) < 0, "fsync failed\n");
+	close(fd);
+}
+
+// form the name of a file of the journal: <path><suffix>
+char *journal_file(journal_t *journal, char *suffix)
+{
+	char *name = malloc(strlen(journal->path) + strlen(suffix) + 1);
+	DIE(!name, "malloc failed\n");
+
+	sprintf(name, "%s%s", journal->path, suffix);
+	return name;
+}
+
+// form the name of the log that follows checkpoint number gen
+char *journal_log_file(journal_t *journal, unsigned long gen)
+{
+	char suffix[32];
+
+	sprintf(suffix, ".%lu", gen);
+	return journal_file(journal, suffix);
+}
+
+// add a record to the journal; it reaches the disk with the next flush
+void journal_append(journal_t *journal, char op, char word[MAX_WORD_LENGTH])
+{
+	size_t word_len = strlen(word);
+
+	pthread_mutex_lock(&journal->lock);
+
+	if (journal->len + word_len + 3 > journal->cap) {
+		while (journal->len + word_len + 3 > journal->cap)
+			journal->cap *= 2;
+
+		journal->buf = realloc(journal->buf, journal->cap);
+		DIE(!journal->buf, "realloc failed\n");
+	}
+
+	// the record is a line: the operation, a space and the word
+	journal->buf[journal->len++] = op;
+	journal->buf[journal->len++] = ' ';
+	memcpy(journal->buf + journal->len, word, word_len);
+	journal->len += word_len;
+	journal->buf[journal->len++] = '\n';
+
+	journal->appended++;
+	journal->since_checkpoint++;
+
+	pthread_cond_signal(&journal->flush_cond);
+	if (journal->since_checkpoint == JOURNAL_CHECKPOINT_RECORDS)
+		pthread_cond_signal(&journal->checkpoint_cond);
+
+	pthread_mutex_unlock(&journal->lock);
+}
+
+// the number of the last record appended to the journal
+uint64_t journal_last_record(journal_t *journal)
+{
+	pthread_mutex_lock(&journal->lock);
+	uint64_t lsn = journal->appended;
+	pthread_mutex_unlock(&journal->lock);
+
+	return lsn;
+}
+
+// wait until the record with the given number is on disk
+void journal_wait(journal_t *journal, uint64_t lsn)
+{
+	pthread_mutex_lock(&journal->lock);
+	while (journal->durable < lsn)
+		pthread_cond_wait(&journal->durable_cond, &journal->lock);
+	pthread_mutex_unlock(&journal->lock);
+}
+
+/* function executed by the flusher thread: it takes all the records
+gathered so far, writes them with a single write and a single fsync and then
+wakes up everyone waiting for them */
+void *journal_flusher(void *arg)
+{
+	journal_t *journal = arg;
+
+	// the buffer swapped with the one of the journal at every flush
+	size_t spare_cap = journal->cap;
+	char *spare = malloc(spare_cap);
+	DIE(!spare, "malloc failed\n");
 
-	/* read commands from the user and call the specific
-	functions until we meet the "EXIT" command */
 	while (1) {
-		if (strcmp(command, "INSERT") == 0) {
-			scanf("%s", word);
-			insert_word(trie, word);
-		} else if (strcmp(command, "REMOVE") == 0) {
-			scanf("%s", word);
-			remove_word(trie, word);
+		pthread_mutex_lock(&journal->lock);
+		while (journal->len == 0 && !journal->stop)
+			pthread_cond_wait(&journal->flush_cond, &journal->lock);
+
+		if (journal->len == 0) {
+			pthread_mutex_unlock(&journal->lock);
+			break;
+		}
+		pthread_mutex_unlock(&journal->lock);
+
+		pthread_mutex_lock(&journal->io_lock);
+		pthread_mutex_lock(&journal->lock);
+
+		// the checkpoint thread may have written the records meanwhile
+		char *batch = journal->buf;
+		size_t batch_len = journal->len;
+		size_t batch_cap = journal->cap;
+		uint64_t batch_lsn = journal->appended;
+
+		journal->buf = spare;
+		journal->cap = spare_cap;
+		journal->len = 0;
+		pthread_mutex_unlock(&journal->lock);
+
+		if (batch_len > 0) {
+			write_all(journal->fd, batch, batch_len);
+			DIE(fdatasync(journal->fd) < 0, "fdatasync failed\n");
+		}
+
+		pthread_mutex_lock(&journal->lock);
+		if (batch_lsn > journal->durable)
+			journal->durable = batch_lsn;
+		pthread_cond_broadcast(&journal->durable_cond);
+		pthread_mutex_unlock(&journal->lock);
+
+		pthread_mutex_unlock(&journal->io_lock);
+
+		spare = batch;
+		spare_cap = batch_cap;
+	}
+
+	free(spare);
+	return NULL;
+}
+
+// recursive function that writes every word of a subtrie with its frequency
+void checkpoint_words(FILE *f, trie_node_t *node, char word[MAX_WORD_LENGTH],
+					  int length)
+{
+	if (node->end_of_word > 0)
+		fprintf(f, "%.*s %d\n", length, word, node->end_of_word);
+
+	for (int i = 0; i < ALPHABET_SIZE; i++) {
+		if (!node->children[i])
+			continue;
+
+		word[length] = node->children[i]->letter;
+		checkpoint_words(f, node->children[i], word, length + 1);
+	}
+}
+
+/* save the whole trie and start a new log. The trie is only locked while
+it is copied to memory; writing the copy to disk does not block anyone */
+void journal_checkpoint(journal_t *journal)
+{
+	trie_t *trie = journal->trie;
+
+	pthread_rwlock_rdlock(&trie->lock);
+
+	/* no update can happen now, so the records appended so far are exactly
+	the ones in the trie: they go to the old log and the next ones to a new
+	log, which belongs to the checkpoint we are about to write. io_lock is
+	kept until the old log is on disk, so the flusher cannot make the records
+	of the new log durable before the ones they follow */
+	pthread_mutex_lock(&journal->io_lock);
+	pthread_mutex_lock(&journal->lock);
+
+	char *old_buf = journal->buf;
+	size_t old_len = journal->len;
+	uint64_t old_lsn = journal->appended;
+
+	journal->buf = malloc(journal->cap);
+	DIE(!journal->buf, "malloc failed\n");
+	journal->len = 0;
+
+	unsigned long gen = journal->gen + 1;
+	char *log_name = journal_log_file(journal, gen);
+	int old_fd = journal->fd;
+
+	journal->fd = open(log_name, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND |
+					   O_CLOEXEC, 0644);
+	DIE(journal->fd < 0, "open failed\n");
+
+	journal->gen = gen;
+	journal->since_checkpoint = 0;
+
+	pthread_mutex_unlock(&journal->lock);
+
+	/* form the checkpoint in memory, so that the trie lock is held only for
+	the walk of the trie: an update waiting for the lock makes the new
+	readers wait as well, so the disk I/O must happen without the lock */
+	char *data = NULL;
+	size_t data_len = 0;
+	char word[MAX_WORD_LENGTH];
+
+	FILE *mem = open_memstream(&data, &data_len);
+	DIE(!mem, "open_memstream failed\n");
+	fprintf(mem, "CHECKPOINT %lu\n", gen);
+	checkpoint_words(mem, trie->root, word, 0);
+	DIE(fclose(mem) != 0, "fclose failed\n");
+
+	pthread_rwlock_unlock(&trie->lock);
+
+	// finish the old log and make the new one part of the directory
+	write_all(old_fd, old_buf, old_len);
+	DIE(fdatasync(old_fd) < 0, "fdatasync failed\n");
+	fsync_dir(log_name);
+	free(log_name);
+	free(old_buf);
+
+	pthread_mutex_lock(&journal->lock);
+	if (old_lsn > journal->durable)
+		journal->durable = old_lsn;
+	pthread_cond_broadcast(&journal->durable_cond);
+	pthread_mutex_unlock(&journal->lock);
+
+	pthread_mutex_unlock(&journal->io_lock);
+	close(old_fd);
+
+	// write the checkpoint to a temporary file and then replace the old one
+	char *tmp_name = journal_file(journal, ".checkpoint.tmp");
+	char *checkpoint_name = journal_file(journal, ".checkpoint");
+	int ok = 0;
+
+	FILE *f = fopen(tmp_name, "w");
+	if (f) {
+		ok = fwrite(data, 1, data_len, f) == data_len;
+		ok = fflush(f) == 0 && fsync(fileno(f)) == 0 && ok;
+		ok = fclose(f) == 0 && ok;
+	}
+	free(data);
+
+	/* if the checkpoint could not be written, the older logs are kept and
+	the old checkpoint is still valid together with all of them */
+	if (!ok || rename(tmp_name, checkpoint_name) < 0) {
+		perror("checkpoint failed");
+		unlink(tmp_name);
+	} else {
+		fsync_dir(checkpoint_name);
+
+		// the logs before the new checkpoint are not needed anymore
+		for (unsigned long i = journal->checkpoint_gen; i < gen; i++) {
+			log_name = journal_log_file(journal, i);
+			unlink(log_name);
+			free(log_name);
+		}
+		journal->checkpoint_gen = gen;
+	}
+
+	free(tmp_name);
+	free(checkpoint_name);
+}
+
+/* function executed by the checkpoint thread: a checkpoint is written when
+the log becomes long enough, or after a while if the log is not empty */
+void *journal_checkpointer(void *arg)
+{
+	journal_t *journal = arg;
+
+	pthread_mutex_lock(&journal->lock);
+
+	while (!journal->stop) {
+		struct timespec deadline;
+
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += JOURNAL_CHECKPOINT_INTERVAL;
+
+		while (!journal->stop &&
+			   journal->since_checkpoint < JOURNAL_CHECKPOINT_RECORDS) {
+			if (pthread_cond_timedwait(&journal->checkpoint_cond,
+									   &journal->lock, &deadline) != 0)
+				break;
+		}
+
+		if (journal->stop || journal->since_checkpoint == 0)
+			continue;
+
+		pthread_mutex_unlock(&journal->lock);
+		journal_checkpoint(journal);
+		pthread_mutex_lock(&journal->lock);
+	}
+
+	pthread_mutex_unlock(&journal->lock);
+	return NULL;
+}
+
+/* parse a line read from a log (n bytes, including the '\n'); returns 1 if
+it is a complete and valid record */
+int parse_record(char *line, ssize_t n, char *op, char word[MAX_WORD_LENGTH])
+{
+	// a record is a whole line of text, so it has no NUL byte inside
+	if (n < 2 || line[n - 1] != '\n' || memchr(line, '\0', n))
+		return 0;
+
+	line[n - 1] = '\0';
+	if (n - 1 > MAX_WORD_LENGTH + 1 ||
+		sscanf(line, "%c %49s", op, word) != 2 || (*op != 'I' && *op != 'R'))
+		return 0;
+
+	return valid_word(word) && strlen(word) + 2 == (size_t)(n - 1);
+}
+
+/* replay the records of a log on the trie and return their number.
+
+A crash can leave the end of the log cut in the middle of a record, or
+filled with zeros when the size of the file reached the disk before the
+data did. So an invalid record followed by no valid one is a torn tail: it
+is dropped and the log is truncated after the last good record. An invalid
+record followed by valid ones means the log is corrupted, and the recovery
+stops instead of losing the records after it */
+long replay_log(trie_t *trie, char *log_name)
+{
+	FILE *f = fopen(log_name, "r");
+	if (!f)
+		return -1;
+
+	char *line = NULL;
+	size_t line_cap = 0;
+	ssize_t n;
+	char word[MAX_WORD_LENGTH];
+	char op;
+	long records = 0, good_end = 0;
+
+	while ((n = getline(&line, &line_cap, f)) > 0) {
+		if (parse_record(line, n, &op, word)) {
+			if (op == 'I')
+				insert_word(trie, word);
+			else
+				remove_word(trie, word);
+
+			records++;
+			good_end = ftell(f);
+			continue;
+		}
+
+		// look for a valid record after the invalid one
+		int valid_after = 0;
+		while (!valid_after && (n = getline(&line, &line_cap, f)) > 0)
+			valid_after = parse_record(line, n, &op, word);
+
+		if (valid_after) {
+			fprintf(stderr, "Corrupted record in %s at offset %ld\n",
+					log_name, good_end);
+			exit(EXIT_FAILURE);
+		}
+
+		fprintf(stderr, "Dropped the torn tail of %s at offset %ld\n",
+				log_name, good_end);
+		DIE(truncate(log_name, good_end) < 0, "truncate failed\n");
+		break;
+	}
+
+	free(line);
+	fclose(f);
+	return records;
+}
+
+// load the words of a checkpoint, with their frequencies
+long load_checkpoint(trie_t *trie, char *checkpoint_name,
+					 unsigned long *gen)
+{
+	FILE *f = fopen(checkpoint_name, "r");
+	if (!f)
+		return -1;
+
+	char word[MAX_WORD_LENGTH];
+	int count;
+	long words = 0;
+
+	if (fscanf(f, "CHECKPOINT %lu", gen) != 1) {
+		fprintf(stderr, "Invalid checkpoint %s\n", checkpoint_name);
+		exit(EXIT_FAILURE);
+	}
+
+	while (fscanf(f, "%49s %d", word, &count) == 2) {
+		if (!valid_word(word) || count <= 0)
+			continue;
+
+		trie_node_t *node = find_or_create_path(trie, word);
+
+		if (trie->filter && node->end_of_word == 0)
+			filter_add(trie->filter, word);
+		node->end_of_word += count;
+		words++;
+	}
+
+	fclose(f);
+	return words;
+}
+
+/* rebuild the trie from the last checkpoint and the logs that follow it,
+then start recording the updates of the trie in the journal at path */
+journal_t *journal_open(trie_t *trie, char *path)
+{
+	journal_t *journal = calloc(1, sizeof(journal_t));
+	DIE(!journal, "calloc failed\n");
+
+	journal->trie = trie;
+	journal->path = path;
+
+	char *checkpoint_name = journal_file(journal, ".checkpoint");
+	long words = load_checkpoint(trie, checkpoint_name, &journal->gen);
+	free(checkpoint_name);
+
+	if (words < 0)
+		words = 0;
+	journal->checkpoint_gen = journal->gen;
+
+	/* replay the log of the checkpoint and the one started by an unfinished
+	checkpoint, if there is one */
+	long records = 0;
+
+	while (1) {
+		char *log_name = journal_log_file(journal, journal->gen);
+		long n = replay_log(trie, log_name);
+
+		free(log_name);
+		if (n >= 0)
+			records += n;
+
+		log_name = journal_log_file(journal, journal->gen + 1);
+		int next_exists = access(log_name, F_OK) == 0;
+
+		free(log_name);
+		if (!next_exists)
+			break;
+		journal->gen++;
+	}
+
+	// remove the logs left behind by a checkpoint that was interrupted
+	for (unsigned long i = journal->checkpoint_gen; i-- > 0;) {
+		char *log_name = journal_log_file(journal, i);
+		int removed = unlink(log_name) == 0;
+
+		free(log_name);
+		if (!removed)
+			break;
+	}
+
+	char *log_name = journal_log_file(journal, journal->gen);
+	journal->fd = open(log_name, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+					   0644);
+	DIE(journal->fd < 0, "open failed\n");
+	fsync_dir(log_name);
+	free(log_name);
+
+	fprintf(stderr, "Recovered %ld words from the checkpoint and %ld "
+			"records from the journal\n", words, records);
+
+	journal->cap = 4096;
+	journal->buf = malloc(journal->cap);
+	DIE(!journal->buf, "malloc failed\n");
+	journal->since_checkpoint = records;
+
+	pthread_mutex_init(&journal->lock, NULL);
+	pthread_mutex_init(&journal->io_lock, NULL);
+	pthread_cond_init(&journal->flush_cond, NULL);
+	pthread_cond_init(&journal->durable_cond, NULL);
+	pthread_cond_init(&journal->checkpoint_cond, NULL);
+
+	/* the threads of the journal start with all the signals blocked, so
+	that the signals always reach the thread that expects them */
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+
+	DIE(pthread_create(&journal->flusher, NULL, journal_flusher,
+					   journal) != 0, "pthread_create failed\n");
+	DIE(pthread_create(&journal->checkpointer, NULL, journal_checkpointer,
+					   journal) != 0, "pthread_create failed\n");
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	// from now on, the updates of the trie are recorded
+	trie->journal = journal;
+
+	return journal;
+}
+
+/* stop recording the updates of the trie, after all the records have
+reached the disk */
+void journal_close(journal_t *journal)
+{
+	pthread_mutex_lock(&journal->lock);
+	journal->stop = 1;
+	pthread_cond_signal(&journal->flush_cond);
+	pthread_cond_signal(&journal->checkpoint_cond);
+	pthread_mutex_unlock(&journal->lock);
+
+	pthread_join(journal->checkpointer, NULL);
+	pthread_join(journal->flusher, NULL);
+
+	journal->trie->journal = NULL;
+	close(journal->fd);
+
+	pthread_mutex_destroy(&journal->lock);
+	pthread_mutex_destroy(&journal->io_lock);
+	pthread_cond_destroy(&journal->flush_cond);
+	pthread_cond_destroy(&journal->durable_cond);
+	pthread_cond_destroy(&journal->checkpoint_cond);
+
+	free(journal->buf);
+	free(journal);
+}
+
+/* the server mode keeps a single trie shared by all the clients connected to
+a Unix domain socket. The event loop only does the I/O: every request line is
+handed to a pool of worker threads, which run the read queries (AUTOCOMPLETE,
+AUTOCORRECT) in parallel under a read lock, while the updates (INSERT, REMOVE,
+LOAD) take the lock exclusively. Every response ends with an empty line, so
+that a client can send many requests without waiting for the answers */
+typedef struct serve_conn_t serve_conn_t;
+typedef struct serve_job_t serve_job_t;
+
+struct serve_job_t {
+	// the connection that sent the request
+	serve_conn_t *conn;
+
+	/* the parsed request; the command is empty if the line was not a valid
+	request, in which case the response will only contain the empty line */
+	char command[MAX_COMMAND];
+	char arg[MAX_WORD_LENGTH];
+	int number;
+
+	// 1 if the request modifies the trie (INSERT, REMOVE or LOAD)
+	int is_write;
+
+	/* the response formed by the worker thread and the indicator set by the
+	event loop once the worker has finished with this job */
+	char *resp;
+	size_t resp_len;
+	int done;
+
+	// next job in the work queue or in the completion queue
+	serve_job_t *next_queued;
+
+	// next job of the same connection, in the order of the requests
+	serve_job_t *next_in_conn;
+};
+
+struct serve_conn_t {
+	int fd;
+
+	// the events currently registered in epoll for this connection
+	uint32_t events;
+
+	// the bytes received that do not form a dispatched request yet
+	char in[SERVE_IN_BUF];
+	size_t in_len;
+
+	// the responses that have not been sent to the client yet
+	char *out;
+	size_t out_len;
+	size_t out_sent;
+	size_t out_cap;
+
+	/* the jobs of this connection that have not been answered yet, in the
+	order the requests were received, and how many of them are still
+	processed by the workers (and if one of them is an update) */
+	serve_job_t *head;
+	serve_job_t *tail;
+	int inflight;
+	int write_inflight;
+
+	/* eof is set when no more requests will be read (the client has closed
+	its side or has sent EXIT); broken is set when the connection failed and
+	closed once the connection is finished and waits to be freed */
+	int eof;
+	int broken;
+	int closed;
+
+	// 1 while the descriptor is registered in epoll
+	int registered;
+
+	/* links in the list of all the connections (or in the list of closed
+	connections, for which only next is used) */
+	serve_conn_t *prev;
+	serve_conn_t *next;
+
+	// link in the list of connections with freshly completed jobs
+	serve_conn_t *next_dirty;
+	int dirty;
+};
+
+typedef struct serve_t serve_t;
+struct serve_t {
+	trie_t *trie;
+
+	int epoll_fd;
+	int listen_fd;
+	int event_fd;
+	int signal_fd;
+
+	// jobs waiting for a worker
+	pthread_mutex_t work_lock;
+	pthread_cond_t work_cond;
+	serve_job_t *work_head;
+	serve_job_t *work_tail;
+	int stop;
+
+	// jobs finished by the workers, not yet seen by the event loop
+	pthread_mutex_t done_lock;
+	serve_job_t *done_head;
+
+	pthread_t *workers;
+	int n_workers;
+
+	serve_conn_t *conns;
+
+	/* connections closed while handling a batch of events; they are freed
+	after the batch, since a later event of it can still point to them */
+	serve_conn_t *closed;
+};
+
+/* check that the argument read by sscanf ends at position end of the line,
+namely that it has not been truncated to the size of its buffer */
+int whole_arg(char *line, int end)
+{
+	return line[end] == '\0' || line[end] == ' ' || line[end] == '\t' ||
+		   line[end] == '\r';
+}
+
+/* parse a request line received by the server; returns 1 for a request that
+must be answered, 0 for a blank line and -1 for EXIT */
+int parse_request(char *line, serve_job_t *job)
+{
+	char command[MAX_COMMAND];
+	int n, end = 0;
+
+	job->command[0] = '\0';
+	job->is_write = 0;
+
+	if (sscanf(line, "%29s", command) != 1)
+		return 0;
+
+	if (strcmp(command, "EXIT") == 0)
+		return -1;
+
+	if (strcmp(command, "INSERT") == 0 || strcmp(command, "REMOVE") == 0) {
+		n = sscanf(line, "%*s %49s%n", job->arg, &end);
+		if (n != 1 || !whole_arg(line, end) || !valid_word(job->arg))
+			return 1;
+		job->is_write = 1;
+	} else if (strcmp(command, "AUTOCORRECT") == 0) {
+		n = sscanf(line, "%*s %49s%n %d", job->arg, &end, &job->number);
+		if (n != 2 || !whole_arg(line, end) || !valid_word(job->arg) ||
+			job->number < 0)
+			return 1;
+	} else if (strcmp(command, "AUTOCOMPLETE") == 0) {
+		n = sscanf(line, "%*s %49s%n %d", job->arg, &end, &job->number);
+		if (n != 2 || !whole_arg(line, end) || !valid_word(job->arg) ||
+			job->number < 0 || job->number > 3)
+			return 1;
+	} else if (strcmp(command, "STATS") == 0) {
+		// the statistics of the filter are only read
+	} else if (strcmp(command, "LOAD") == 0) {
+		// the file name must fit in the buffer used by load_file
+		n = sscanf(line, "%*s %29s%n", job->arg, &end);
+		if (n != 1 || !whole_arg(line, end))
+			return 1;
+		job->is_write = 1;
+	} else {
+		return 1;
+	}
+
+	strcpy(job->command, command);
+	return 1;
+}
+
+// run a parsed request on the trie and write its response to out
+void execute_request(trie_t *trie, serve_job_t *job, FILE *out)
+{
+	if (strcmp(job->command, "INSERT") == 0)
+		insert_word(trie, job->arg);
+	else if (strcmp(job->command, "REMOVE") == 0)
+		remove_word(trie, job->arg);
+	else if (strcmp(job->command, "AUTOCORRECT") == 0)
+		prepare_autocorrect(trie, job->number, job->arg, out);
+	else if (strcmp(job->command, "AUTOCOMPLETE") == 0)
+		prepare_autocomplete(job->arg, job->number, trie, out);
+	else if (strcmp(job->command, "LOAD") == 0)
+		load_file(trie, job->arg);
+	else if (strcmp(job->command, "STATS") == 0)
+		print_stats(trie, out);
+
+	// the empty line marks the end of the response
+	fprintf(out, "\n");
+}
+
+// function executed by every worker thread of the server
+void *serve_worker(void *arg)
+{
+	serve_t *srv = arg;
+	uint64_t one = 1;
+
+	while (1) {
+		// wait for a job or for the server to stop
+		pthread_mutex_lock(&srv->work_lock);
+		while (!srv->work_head && !srv->stop)
+			pthread_cond_wait(&srv->work_cond, &srv->work_lock);
+
+		if (!srv->work_head) {
+			pthread_mutex_unlock(&srv->work_lock);
+			break;
+		}
+
+		serve_job_t *job = srv->work_head;
+		srv->work_head = job->next_queued;
+		if (!srv->work_head)
+			srv->work_tail = NULL;
+		pthread_mutex_unlock(&srv->work_lock);
+
+		// form the response in memory, holding the trie lock
+		FILE *out = open_memstream(&job->resp, &job->resp_len);
+		DIE(!out, "open_memstream failed\n");
+
+		trie_t *trie = srv->trie;
+		uint64_t before = 0, lsn = 0;
+
+		if (job->is_write)
+			pthread_rwlock_wrlock(&trie->lock);
+		else
+			pthread_rwlock_rdlock(&trie->lock);
+
+		if (job->is_write && trie->journal)
+			before = journal_last_record(trie->journal);
+
+		execute_request(trie, job, out);
+
+		/* remember the journal record that must be on disk before answering,
+		if the request has written any (a REMOVE of a missing word does not) */
+		if (job->is_write && trie->journal) {
+			lsn = journal_last_record(trie->journal);
+			if (lsn == before)
+				lsn = 0;
+		}
+
+		pthread_rwlock_unlock(&trie->lock);
+		fclose(out);
+
+		/* the updates are answered only once they are on disk; the workers
+		waiting here share the same fsync */
+		if (lsn)
+			journal_wait(trie->journal, lsn);
+
+		// hand the job back to the event loop and wake it up
+		pthread_mutex_lock(&srv->done_lock);
+		job->next_queued = srv->done_head;
+		srv->done_head = job;
+		pthread_mutex_unlock(&srv->done_lock);
+
+		DIE(write(srv->event_fd, &one, sizeof(one)) < 0, "write failed\n");
+	}
+
+	return NULL;
+}
+
+// append bytes to the output buffer of a connection
+void conn_append(serve_conn_t *conn, char *data, size_t len)
+{
+	if (conn->out_len + len > conn->out_cap) {
+		size_t new_cap = conn->out_cap ? conn->out_cap : SERVE_IN_BUF;
+
+		while (new_cap < conn->out_len + len)
+			new_cap *= 2;
+
+		conn->out = realloc(conn->out, new_cap);
+		DIE(!conn->out, "realloc failed\n");
+		conn->out_cap = new_cap;
+	}
+
+	memcpy(conn->out + conn->out_len, data, len);
+	conn->out_len += len;
+}
+
+/* check if the next request of a connection can be given to the workers.
+Consecutive read queries may run at the same time, but an update has to wait
+for all the previous requests and the requests after it have to wait for the
+update, so that every client sees its own commands applied in order */
+int conn_can_dispatch(serve_conn_t *conn, int is_write)
+{
+	if (conn->inflight >= SERVE_MAX_PIPELINE || conn->write_inflight)
+		return 0;
+
+	// stop taking requests from a client that does not read the responses
+	if (conn->out_len - conn->out_sent > SERVE_OUT_HIGH)
+		return 0;
+
+	if (is_write && conn->inflight > 0)
+		return 0;
+
+	return 1;
+}
+
+// split the received bytes into requests and dispatch as many as possible
+void conn_parse(serve_t *srv, serve_conn_t *conn)
+{
+	size_t pos = 0;
+
+	while (!srv->stop && !conn->broken && pos < conn->in_len) {
+		char *start = conn->in + pos;
+		char *newline = memchr(start, '\n', conn->in_len - pos);
+		char line[SERVE_IN_BUF + 1];
+		size_t len;
+
+		if (newline) {
+			len = newline - start;
+		} else if (pos == 0 && conn->in_len == SERVE_IN_BUF) {
+			// a line that does not fit in the buffer is not a valid request
+			conn->broken = 1;
+			break;
+		} else {
+			break;
+		}
+
+		memcpy(line, start, len);
+		line[len] = '\0';
+
+		serve_job_t job;
+		int ret = parse_request(line, &job);
+
+		if (ret == -1) {
+			/* EXIT only ends the session of this client, so whatever it sent
+			after this command is ignored */
+			conn->eof = 1;
+			pos = conn->in_len;
+			break;
+		}
+
+		if (ret == 0) {
+			pos += len + 1;
+			continue;
+		}
+
+		if (!conn_can_dispatch(conn, job.is_write))
+			break;
+
+		serve_job_t *new_job = malloc(sizeof(serve_job_t));
+		DIE(!new_job, "malloc failed\n");
+		*new_job = job;
+		new_job->conn = conn;
+		new_job->resp = NULL;
+		new_job->resp_len = 0;
+		new_job->done = 0;
+		new_job->next_queued = NULL;
+		new_job->next_in_conn = NULL;
+
+		// remember the order of the requests of this connection
+		if (conn->tail)
+			conn->tail->next_in_conn = new_job;
+		else
+			conn->head = new_job;
+		conn->tail = new_job;
+
+		conn->inflight++;
+		if (new_job->is_write)
+			conn->write_inflight = 1;
+
+		pthread_mutex_lock(&srv->work_lock);
+		if (srv->work_tail)
+			srv->work_tail->next_queued = new_job;
+		else
+			srv->work_head = new_job;
+		srv->work_tail = new_job;
+		pthread_cond_signal(&srv->work_cond);
+		pthread_mutex_unlock(&srv->work_lock);
+
+		pos += len + 1;
+	}
+
+	// keep only the bytes that have not been consumed yet
+	memmove(conn->in, conn->in + pos, conn->in_len - pos);
+	conn->in_len -= pos;
+}
+
+// send as much of the pending output as the socket accepts
+void conn_flush(serve_conn_t *conn)
+{
+	while (!conn->broken && conn->out_sent < conn->out_len) {
+		ssize_t n = send(conn->fd, conn->out + conn->out_sent,
+						 conn->out_len - conn->out_sent, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+				conn->broken = 1;
+			if (errno != EINTR)
+				break;
+			continue;
+		}
+		conn->out_sent += n;
+	}
+
+	if (conn->out_sent == conn->out_len) {
+		conn->out_sent = 0;
+		conn->out_len = 0;
+	}
+}
+
+// stop watching a connection in epoll
+void conn_unregister(serve_t *srv, serve_conn_t *conn)
+{
+	if (!conn->registered)
+		return;
+
+	epoll_ctl(srv->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+	conn->registered = 0;
+}
+
+/* close a connection and move it to the list of connections that will be
+freed after the current batch of events */
+void conn_close(serve_t *srv, serve_conn_t *conn)
+{
+	if (conn->prev)
+		conn->prev->next = conn->next;
+	else
+		srv->conns = conn->next;
+	if (conn->next)
+		conn->next->prev = conn->prev;
+
+	conn_unregister(srv, conn);
+	close(conn->fd);
+	conn->closed = 1;
+
+	conn->next = srv->closed;
+	srv->closed = conn;
+}
+
+// free the connections closed during the last batch of events
+void serve_free_closed(serve_t *srv)
+{
+	while (srv->closed) {
+		serve_conn_t *conn = srv->closed;
+
+		srv->closed = conn->next;
+		free(conn->out);
+		free(conn);
+	}
+}
+
+/* move the answered requests of a connection into its output buffer, try to
+send them, dispatch more requests if possible and decide which events we are
+interested in. The connection is closed once it is finished and no worker
+holds any of its jobs anymore */
+void conn_progress(serve_t *srv, serve_conn_t *conn)
+{
+	while (conn->head && conn->head->done) {
+		serve_job_t *job = conn->head;
+
+		conn->head = job->next_in_conn;
+		if (!conn->head)
+			conn->tail = NULL;
+
+		if (!conn->broken)
+			conn_append(conn, job->resp, job->resp_len);
+		free(job->resp);
+		free(job);
+	}
+
+	conn_parse(srv, conn);
+	conn_flush(conn);
+
+	if (!conn->head && (conn->broken || (conn->eof && conn->in_len == 0 &&
+										  conn->out_len == 0))) {
+		conn_close(srv, conn);
+		return;
+	}
+
+	// the jobs of a failed connection are only waited for, without events
+	if (conn->broken) {
+		conn_unregister(srv, conn);
+		return;
+	}
+
+	uint32_t events = 0;
+	if (!conn->eof && conn->in_len < SERVE_IN_BUF)
+		events |= EPOLLIN;
+	if (conn->out_len > 0)
+		events |= EPOLLOUT;
+
+	if (events != conn->events) {
+		struct epoll_event ev = { .events = events, .data.ptr = conn };
+
+		DIE(epoll_ctl(srv->epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev) < 0,
+			"epoll_ctl failed\n");
+		conn->events = events;
+	}
+}
+
+// accept all the clients waiting on the listening socket
+void serve_accept(serve_t *srv)
+{
+	while (1) {
+		int fd = accept4(srv->listen_fd, NULL, NULL,
+						 SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			// EAGAIN means there are no more clients waiting
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				perror("accept failed");
+			return;
+		}
+
+		serve_conn_t *conn = calloc(1, sizeof(serve_conn_t));
+		DIE(!conn, "calloc failed\n");
+		conn->fd = fd;
+		conn->events = EPOLLIN;
+		conn->registered = 1;
+
+		struct epoll_event ev = { .events = EPOLLIN, .data.ptr = conn };
+		DIE(epoll_ctl(srv->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0,
+			"epoll_ctl failed\n");
+
+		conn->next = srv->conns;
+		if (srv->conns)
+			srv->conns->prev = conn;
+		srv->conns = conn;
+	}
+}
+
+// read the requests available on a connection
+void serve_read(serve_t *srv, serve_conn_t *conn)
+{
+	while (!conn->eof && !conn->broken && conn->in_len < SERVE_IN_BUF) {
+		ssize_t n = recv(conn->fd, conn->in + conn->in_len,
+						 SERVE_IN_BUF - conn->in_len, 0);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				conn->broken = 1;
+			break;
+		}
+
+		if (n == 0) {
+			/* the client will not send anything else, but it still gets
+			the answers to its requests; a last line without '\n' counts */
+			if (conn->in_len < SERVE_IN_BUF)
+				conn->in[conn->in_len++] = '\n';
+			conn->eof = 1;
+			break;
+		}
+
+		conn->in_len += n;
+	}
+
+	conn_progress(srv, conn);
+}
+
+// collect the jobs finished by the workers and answer them
+void serve_completions(serve_t *srv)
+{
+	uint64_t count;
+	serve_conn_t *dirty = NULL;
+
+	if (read(srv->event_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		DIE(1, "read failed\n");
+
+	pthread_mutex_lock(&srv->done_lock);
+	serve_job_t *job = srv->done_head;
+	srv->done_head = NULL;
+	pthread_mutex_unlock(&srv->done_lock);
+
+	/* first mark the jobs as done and only then touch the connections,
+	because answering a job can free its connection */
+	while (job) {
+		serve_job_t *next = job->next_queued;
+		serve_conn_t *conn = job->conn;
+
+		job->done = 1;
+		conn->inflight--;
+		if (job->is_write)
+			conn->write_inflight = 0;
+
+		if (!conn->dirty) {
+			conn->dirty = 1;
+			conn->next_dirty = dirty;
+			dirty = conn;
+		}
+
+		job = next;
+	}
+
+	while (dirty) {
+		serve_conn_t *next = dirty->next_dirty;
+
+		dirty->dirty = 0;
+		conn_progress(srv, dirty);
+		dirty = next;
+	}
+}
+
+/* serve the commands of many clients at once on a Unix domain socket, until
+the process receives SIGINT or SIGTERM; if n_workers is not positive, one
+worker thread is started for every online CPU */
+void serve(trie_t *trie, char *socket_path, int n_workers)
+{
+	serve_t srv;
+	struct sockaddr_un addr;
+	struct epoll_event ev;
+
+	memset(&srv, 0, sizeof(srv));
+	srv.trie = trie;
+
+	if (n_workers <= 0)
+		n_workers = sysconf(_SC_NPROCESSORS_ONLN);
+	if (n_workers <= 0)
+		n_workers = 1;
+
+	pthread_mutex_init(&srv.work_lock, NULL);
+	pthread_cond_init(&srv.work_cond, NULL);
+	pthread_mutex_init(&srv.done_lock, NULL);
+
+	// create the listening socket
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Socket path too long\n");
+		exit(EXIT_FAILURE);
+	}
+	strcpy(addr.sun_path, socket_path);
+
+	srv.listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+						   0);
+	DIE(srv.listen_fd < 0, "socket failed\n");
+
+	// remove the socket left behind by a previous server
+	unlink(socket_path);
+	DIE(bind(srv.listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0,
+		"bind failed\n");
+	DIE(listen(srv.listen_fd, SOMAXCONN) < 0, "listen failed\n");
+
+	// the workers wake up the event loop through an eventfd
+	srv.event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	DIE(srv.event_fd < 0, "eventfd failed\n");
+
+	// SIGINT and SIGTERM are received as events, to stop the server cleanly
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	DIE(sigprocmask(SIG_BLOCK, &mask, NULL) < 0, "sigprocmask failed\n");
+	srv.signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	DIE(srv.signal_fd < 0, "signalfd failed\n");
+
+	srv.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	DIE(srv.epoll_fd < 0, "epoll_create1 failed\n");
+
+	/* the connections are identified by their structure, while the other
+	descriptors are identified by the address of their field in srv */
+	ev.events = EPOLLIN;
+	ev.data.ptr = &srv.listen_fd;
+	DIE(epoll_ctl(srv.epoll_fd, EPOLL_CTL_ADD, srv.listen_fd, &ev) < 0,
+		"epoll_ctl failed\n");
+	ev.data.ptr = &srv.event_fd;
+	DIE(epoll_ctl(srv.epoll_fd, EPOLL_CTL_ADD, srv.event_fd, &ev) < 0,
+		"epoll_ctl failed\n");
+	ev.data.ptr = &srv.signal_fd;
+	DIE(epoll_ctl(srv.epoll_fd, EPOLL_CTL_ADD, srv.signal_fd, &ev) < 0,
+		"epoll_ctl failed\n");
+
+	// the workers inherit the blocked signals, so only signalfd gets them
+	srv.n_workers = n_workers;
+	srv.workers = malloc(n_workers * sizeof(pthread_t));
+	DIE(!srv.workers, "malloc failed\n");
+	for (int i = 0; i < n_workers; i++)
+		DIE(pthread_create(&srv.workers[i], NULL, serve_worker, &srv) != 0,
+			"pthread_create failed\n");
+
+	struct epoll_event events[SERVE_MAX_EVENTS];
+	int running = 1;
+
+	while (running) {
+		int n = epoll_wait(srv.epoll_fd, events, SERVE_MAX_EVENTS, -1);
+		if (n < 0 && errno == EINTR)
+			continue;
+		DIE(n < 0, "epoll_wait failed\n");
+
+		for (int i = 0; i < n; i++) {
+			void *ptr = events[i].data.ptr;
+
+			if (ptr == &srv.listen_fd) {
+				serve_accept(&srv);
+			} else if (ptr == &srv.event_fd) {
+				serve_completions(&srv);
+			} else if (ptr == &srv.signal_fd) {
+				running = 0;
+			} else {
+				serve_conn_t *conn = ptr;
+
+				// skip the connections closed earlier in this batch
+				if (conn->closed || !conn->registered)
+					continue;
+
+				if (events[i].events & (EPOLLERR | EPOLLHUP) &&
+					!(events[i].events & EPOLLIN))
+					conn->broken = 1;
+				if (events[i].events & EPOLLIN)
+					serve_read(&srv, conn);
+				else
+					conn_progress(&srv, conn);
+			}
+		}
+
+		serve_free_closed(&srv);
+	}
+
+	// let the workers finish the jobs they have and stop them
+	pthread_mutex_lock(&srv.work_lock);
+	srv.stop = 1;
+	pthread_cond_broadcast(&srv.work_cond);
+	pthread_mutex_unlock(&srv.work_lock);
+
+	for (int i = 0; i < n_workers; i++)
+		pthread_join(srv.workers[i], NULL);
+	free(srv.workers);
+
+	// send the last answers we can without blocking, then drop the clients
+	serve_completions(&srv);
+	while (srv.conns) {
+		serve_conn_t *conn = srv.conns;
+
+		while (conn->head) {
+			serve_job_t *job = conn->head;
+
+			conn->head = job->next_in_conn;
+			free(job->resp);
+			free(job);
+		}
+		conn_close(&srv, conn);
+	}
+	serve_free_closed(&srv);
+
+	close(srv.epoll_fd);
+	close(srv.signal_fd);
+	close(srv.event_fd);
+	close(srv.listen_fd);
+	unlink(socket_path);
+
+	pthread_mutex_destroy(&srv.work_lock);
+	pthread_cond_destroy(&srv.work_cond);
+	pthread_mutex_destroy(&srv.done_lock);
+}
+
+/* parse a size given in bytes, with an optional k, m or g suffix; returns 0
+if the size is not a positive number or does not fit in a size_t */
+int parse_size(char *str, size_t *size)
+{
+	char *end;
+	int shift = 0;
+
+	if (*str < '0' || *str > '9')
+		return 0;
+
+	errno = 0;
+	unsigned long long value = strtoull(str, &end, 10);
+	if (errno == ERANGE)
+		return 0;
+
+	if (*end == 'k' || *end == 'K')
+		shift = 10;
+	else if (*end == 'm' || *end == 'M')
+		shift = 20;
+	else if (*end == 'g' || *end == 'G')
+		shift = 30;
+
+	if (shift)
+		end++;
+	if (*end != '\0' || value == 0 || value > (SIZE_MAX >> shift))
+		return 0;
+
+	*size = value << shift;
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	char command[MAX_COMMAND];
+	char word[MAX_WORD_LENGTH];
+	char prefix[MAX_WORD_LENGTH];
+	char filename[MAX_FILENAME];
+	int crit_number;
+
+	// options of the server mode and of the journal
+	char *socket_path = NULL;
+	int n_workers = 0;
+	char *journal_path = NULL;
+	size_t filter_budget = 0;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+			socket_path = argv[++i];
+		} else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+			n_workers = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--journal") == 0 && i + 1 < argc) {
+			journal_path = argv[++i];
+		} else if (strcmp(argv[i], "--filter-budget") == 0 &&
+				   i + 1 < argc && parse_size(argv[i + 1], &filter_budget)) {
+			i++;
+		} else {
+			fprintf(stderr, "Usage: %s [--journal <path>] [--filter-budget "
+					"<bytes>[k|m|g]] [--serve <socket path> [--workers "
+					"<count>]]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	// create the trie that we are going to use
+	trie_t *trie = create_trie();
+	int k;
+
+	/* the filter is created first, so that it also learns the words
+	recovered from the journal */
+	if (filter_budget > 0)
+		trie->filter = filter_create(filter_budget);
+
+	/* with a journal, the trie starts with the words saved by the previous
+	runs and every update is saved on disk */
+	journal_t *journal = NULL;
+	if (journal_path)
+		journal = journal_open(trie, journal_path);
+
+	// the statistics only count the lookups made after the recovery
+	if (trie->filter)
+		filter_reset_stats(trie->filter);
+
+	/* in server mode the commands come from the clients of the socket
+	instead of the standard input */
+	if (socket_path) {
+		serve(trie, socket_path, n_workers);
+		if (journal)
+			journal_close(journal);
+		if (trie->filter)
+			filter_free(trie->filter);
+		recursive_free_nodes(trie->root, trie);
+		pthread_rwlock_destroy(&trie->lock);
+		free(trie);
+		return 0;
+	}
+
+	// read the first command introduced by the user
+	scanf("%s", command);
+
+	/* read commands from the user and call the specific
+	functions until we meet the "EXIT" command. The updates take the trie
+	lock, because the checkpoint thread of the journal may be reading it */
+	while (1) {
+		if (strcmp(command, "INSERT") == 0) {
+			scanf("%49s", word);
+			// only the words of lowercase letters fit in the trie
+			if (valid_word(word)) {
+				pthread_rwlock_wrlock(&trie->lock);
+				insert_word(trie, word);
+				pthread_rwlock_unlock(&trie->lock);
+			}
+		} else if (strcmp(command, "REMOVE") == 0) {
+			scanf("%49s", word);
+			if (valid_word(word)) {
+				pthread_rwlock_wrlock(&trie->lock);
+				remove_word(trie, word);
+				pthread_rwlock_unlock(&trie->lock);
+			}
 		} else if (strcmp(command, "AUTOCORRECT") == 0) {
 			scanf("%s", word);
 			scanf("%d", &k);
-			prepare_autocorrect(trie, k, word);
+			prepare_autocorrect(trie, k, word, stdout);
 		} else if (strcmp(command, "EXIT") == 0) {
+			if (journal)
+				journal_close(journal);
+			if (trie->filter)
+				filter_free(trie->filter);
 			recursive_free_nodes(trie->root, trie);
+			pthread_rwlock_destroy(&trie->lock);
 			free(trie);
 			break;
 		} else if (strcmp(command, "AUTOCOMPLETE") == 0) {
 			scanf("%s", prefix);
 			scanf("%d", &crit_number);
-			prepare_autocomplete(prefix, crit_number, trie);
+			prepare_autocomplete(prefix, crit_number, trie, stdout);
 		} else if (strcmp(command, "LOAD") == 0) {
 			scanf("%s", filename);
+			pthread_rwlock_wrlock(&trie->lock);
 			load_file(trie, filename);
+			pthread_rwlock_unlock(&trie->lock);
+		} else if (strcmp(command, "STATS") == 0) {
+			print_stats(trie, stdout);
 		}
 	scanf("%s", command);
 	}
@@ -0,0 +1,306 @@
+// STEFAN MIRUNA ANDREEA 314CA
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_WORD_LENGTH 50
+#define MAX_REQUEST 128
+#define MAX_DEPTH 64
+#define READ_BUF 4096
+#define GENERATED_WORDS 10000
+
+/* useful macro for handling error codes */
+#define DIE(assertion, call_description)                                       \
+	do {                                                                       \
+		if (assertion) {                                                       \
+			fprintf(stderr, "(%s, %d): ", __FILE__, __LINE__);                 \
+			perror(call_description);                                          \
+			exit(errno);                                                       \
+		}                                                                      \
+	} while (0)
+
+/* load generator for "mk --serve": every connection is driven by its own
+thread, which keeps up to depth requests in flight and measures the time
+between sending a request and receiving the empty line that ends its answer */
+
+// the settings of the run, shared by all the client threads
+typedef struct load_t load_t;
+struct load_t {
+	char *socket_path;
+	int n_conns;
+	int n_requests;
+	int depth;
+
+	// percentage of the requests that are INSERT commands
+	int write_ratio;
+
+	// the words used to form the requests
+	char (*words)[MAX_WORD_LENGTH];
+	int n_words;
+};
+
+// the state of a single client thread
+typedef struct client_t client_t;
+struct client_t {
+	load_t *load;
+	unsigned int seed;
+	pthread_t thread;
+
+	// the latency of every request, in microseconds
+	double *latencies;
+	int n_latencies;
+};
+
+double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// form a random request, as a line of the text protocol
+int make_request(load_t *load, unsigned int *seed, char request[MAX_REQUEST])
+{
+	char *word = load->words[rand_r(seed) % load->n_words];
+	int len = strlen(word);
+
+	if (rand_r(seed) % 100 < load->write_ratio)
+		return sprintf(request, "INSERT %s\n", word);
+
+	// half of the read queries are autocompletes of a short prefix
+	if (rand_r(seed) % 2 == 0) {
+		int prefix_length = 1 + rand_r(seed) % (len < 3 ? len : 3);
+
+		return sprintf(request, "AUTOCOMPLETE %.*s %d\n", prefix_length, word,
+					   rand_r(seed) % 4);
+	}
+
+	return sprintf(request, "AUTOCORRECT %s %d\n", word, rand_r(seed) % 2);
+}
+
+// send the whole buffer, even if the socket accepts only a part of it
+void send_all(int fd, char *buf, int len)
+{
+	while (len > 0) {
+		ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		DIE(n < 0, "send failed\n");
+
+		buf += n;
+		len -= n;
+	}
+}
+
+void *client_run(void *arg)
+{
+	client_t *client = arg;
+	load_t *load = client->load;
+	struct sockaddr_un addr;
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	DIE(fd < 0, "socket failed\n");
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, load->socket_path, sizeof(addr.sun_path) - 1);
+	DIE(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0,
+		"connect failed\n");
+
+	// the sending times of the requests in flight, as a circular queue
+	double sent_at[MAX_DEPTH];
+	int first = 0, inflight = 0, sent = 0;
+
+	char buf[READ_BUF];
+	int buf_len = 0;
+
+	/* 1 at the start of a response or after a '\n', where a '\n' is the
+	empty line that ends the response */
+	int after_newline = 1;
+
+	while (client->n_latencies < load->n_requests) {
+		// keep the pipeline full
+		while (sent < load->n_requests && inflight < load->depth) {
+			char request[MAX_REQUEST];
+			int len = make_request(load, &client->seed, request);
+
+			sent_at[(first + inflight) % MAX_DEPTH] = now_us();
+			send_all(fd, request, len);
+			inflight++;
+			sent++;
+		}
+
+		buf_len = recv(fd, buf, READ_BUF, 0);
+		if (buf_len < 0 && errno == EINTR)
+			continue;
+		DIE(buf_len < 0, "recv failed\n");
+		if (buf_len == 0) {
+			fprintf(stderr, "Server closed the connection\n");
+			exit(EXIT_FAILURE);
+		}
+
+		double t = now_us();
+
+		// every response is made of lines and ends with an empty line
+		for (int i = 0; i < buf_len; i++) {
+			if (buf[i] != '\n') {
+				after_newline = 0;
+				continue;
+			}
+
+			if (!after_newline) {
+				after_newline = 1;
+				continue;
+			}
+
+			client->latencies[client->n_latencies++] = t - sent_at[first];
+			first = (first + 1) % MAX_DEPTH;
+			inflight--;
+		}
+	}
+
+	close(fd);
+	return NULL;
+}
+
+int compare_doubles(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+// read the words of a file, or generate random ones if there is no file
+void prepare_words(load_t *load, char *filename)
+{
+	int cap = GENERATED_WORDS;
+
+	load->words = malloc(cap * sizeof(*load->words));
+	DIE(!load->words, "malloc failed\n");
+	load->n_words = 0;
+
+	if (!filename) {
+		unsigned int seed = 1;
+
+		for (int i = 0; i < GENERATED_WORDS; i++) {
+			int len = 3 + rand_r(&seed) % 6;
+
+			for (int j = 0; j < len; j++)
+				load->words[i][j] = 'a' + rand_r(&seed) % 26;
+			load->words[i][len] = '\0';
+		}
+		load->n_words = GENERATED_WORDS;
+		return;
+	}
+
+	FILE *f = fopen(filename, "r");
+	DIE(!f, "fopen failed\n");
+
+	while (fscanf(f, "%49s", load->words[load->n_words]) == 1) {
+		if (++load->n_words == cap) {
+			cap *= 2;
+			load->words = realloc(load->words, cap * sizeof(*load->words));
+			DIE(!load->words, "realloc failed\n");
+		}
+	}
+
+	fclose(f);
+
+	if (load->n_words == 0) {
+		fprintf(stderr, "No words in %s\n", filename);
+		exit(EXIT_FAILURE);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	load_t load = {
+		.n_conns = 8,
+		.n_requests = 10000,
+		.depth = 8,
+		.write_ratio = 5,
+	};
+	char *filename = NULL;
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <socket path> [-c connections] "
+				"[-n requests per connection] [-d pipeline depth] "
+				"[-w insert percentage] [-f word file]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	load.socket_path = argv[1];
+
+	for (int i = 2; i + 1 < argc; i += 2) {
+		if (strcmp(argv[i], "-c") == 0)
+			load.n_conns = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "-n") == 0)
+			load.n_requests = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "-d") == 0)
+			load.depth = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "-w") == 0)
+			load.write_ratio = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "-f") == 0)
+			filename = argv[i + 1];
+	}
+
+	if (load.n_conns < 1 || load.n_requests < 1 || load.depth < 1 ||
+		load.depth > MAX_DEPTH) {
+		fprintf(stderr, "Invalid settings (depth must be 1..%d)\n",
+				MAX_DEPTH);
+		return EXIT_FAILURE;
+	}
+
+	prepare_words(&load, filename);
+
+	client_t *clients = calloc(load.n_conns, sizeof(client_t));
+	DIE(!clients, "calloc failed\n");
+
+	double start = now_us();
+
+	for (int i = 0; i < load.n_conns; i++) {
+		clients[i].load = &load;
+		clients[i].seed = i + 1;
+		clients[i].latencies = malloc(load.n_requests * sizeof(double));
+		DIE(!clients[i].latencies, "malloc failed\n");
+		DIE(pthread_create(&clients[i].thread, NULL, client_run,
+						   &clients[i]) != 0, "pthread_create failed\n");
+	}
+
+	for (int i = 0; i < load.n_conns; i++)
+		pthread_join(clients[i].thread, NULL);
+
+	double elapsed = now_us() - start;
+
+	// gather all the latencies to compute the percentiles
+	long total = (long)load.n_conns * load.n_requests;
+	double *all = malloc(total * sizeof(double));
+	DIE(!all, "malloc failed\n");
+
+	for (int i = 0; i < load.n_conns; i++) {
+		memcpy(all + (long)i * load.n_requests, clients[i].latencies,
+			   load.n_requests * sizeof(double));
+		free(clients[i].latencies);
+	}
+	qsort(all, total, sizeof(double), compare_doubles);
+
+	printf("requests: %ld in %.3f s\n", total, elapsed / 1e6);
+	printf("throughput: %.0f requests/s\n", total / (elapsed / 1e6));
+	printf("latency (us): p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  "
+		   "max %.1f\n", all[total * 50 / 100], all[total * 90 / 100],
+		   all[total * 99 / 100], all[total * 999 / 1000], all[total - 1]);
+
+	free(all);
+	free(clients);
+	free(load.words);
+
+	return 0;
+}